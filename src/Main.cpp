@@ -1,7 +1,9 @@
 #include <chrono> // Record elapsed render time
 #include <iostream>
 #include <iomanip> // Time formatting
-#include <float.h>
+#include <fstream>
+#include <string>
+#include <vector>
 
 #include "rtweekend.h"
 
@@ -9,6 +11,11 @@
 #include "hittableList.h"
 #include "camera.h"
 #include "material.h"
+#include "radianceCache.h"
+#include "renderer.h"
+#include "renderServer.h"
+#include "sequence.h"
+#include "threadPool.h"
 
 /****************************************************************************************
 The code for this path tracer is based on "Ray Tracing in One Weekend" by Peter Shirley. 
@@ -20,40 +27,6 @@ Additional/better graphics to illustrate ray tracing from the "1000 Forms of Bun
 
 
 
-/*
-* Assign colors to pixels
-*
-* Depth is the number of reflections
-*
-* Background -
-* Linearly blends white and blue depending on the value of y coordinate (Linear Blend/Linear Interpolation/lerp).
-* Lerps are always of the form: blended_value = (1-t)*start_value + t*end_value.
-* t = 0.0 = White
-* t = 1.0 = Blue
-*/
-vec3 color(const ray& r, hittable *world, int depth) {
-    hit_record rec;
-
-    if (depth <= 0) {
-        return vec3(0,0,0);
-    }  
-    if (world->hit(r, 0.001, DBL_MAX, rec)) {
-        ray scattered;
-        vec3 attenuation; 
-        if (rec.material_ptr->scatter(r, rec, attenuation, scattered)) {
-            return attenuation*color(scattered, world, depth-1);
-        }
-        else {
-            return vec3(0,0,0);
-        }
-    }
-    else {
-        vec3 unit_direction = unit_vector(r.direction());
-        double t = 0.5*(unit_direction.y() + 1.0);
-        return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
-    }
-}
-
 hittable *random_scene() {
     int n = 500;
     hittable **list = new hittable*[n+1];
@@ -93,47 +66,132 @@ hittable *random_scene() {
     return new hittable_list(list,i);
 }
 
-int main() {
-
-	int nx = 2000; // Number of horizontal pixels
-	int ny = 1000; // Number of vertical pixels
-	int ns = 50; // Number of samples for each pixel for anti-aliasing (see AntiAliasing.png for visualization)
-    int maxDepth = 50; // Ray bounce limit
-	std::cout << "P3\n" << nx << " " << ny << "\n255\n"; // P3 signifies ASCII, 255 signifies max color value
+/*
+* Usage:
+*	PathTracer [options] > image.ppm							render one image to stdout
+*	PathTracer [options] --sequence <keyframes> <frames> <prefix>	render a camera path to <prefix>0000.ppm, ... (see sequence.h)
+*	PathTracer --server <socket path>							keep the scene loaded and serve render jobs (see renderServer.h)
+*
+* Options: --resolution <nx> <ny>, --samples <ns>, --max-depth <depth>
+*          --radiance-cache <cell size> <max error>	cache diffuse indirect light (see radianceCache.h)
+*          --clear-cache-per-frame						empty the radiance cache before each frame of a sequence
+*/
+int main(int argc, char *argv[]) {
+
+    render_settings settings; // defaults: 2000x1000, 50 spp, camera at (13, 2, 3) looking at the origin
+    std::string socketPath;
+    std::string keyframePath;
+    std::string outputPrefix;
+    int frameCount = 0;
+    bool useCache = false;
+    double cacheCellSize = 0;
+    double cacheMaxError = 0;
+    bool clearCachePerFrame = false;
+
+    for (int arg = 1; arg < argc; arg++) {
+        std::string option = argv[arg];
+        int remaining = argc - arg - 1;
+        if (option == "--server" && remaining >= 1) {
+            socketPath = argv[++arg];
+        }
+        else if (option == "--sequence" && remaining >= 3) {
+            keyframePath = argv[++arg];
+            frameCount = atoi(argv[++arg]);
+            outputPrefix = argv[++arg];
+        }
+        else if (option == "--resolution" && remaining >= 2) {
+            settings.nx = atoi(argv[++arg]);
+            settings.ny = atoi(argv[++arg]);
+        }
+        else if (option == "--samples" && remaining >= 1) {
+            settings.ns = atoi(argv[++arg]);
+        }
+        else if (option == "--max-depth" && remaining >= 1) {
+            settings.max_depth = atoi(argv[++arg]);
+        }
+        else if (option == "--radiance-cache" && remaining >= 2) {
+            useCache = true;
+            cacheCellSize = atof(argv[++arg]);
+            cacheMaxError = atof(argv[++arg]);
+            if (!(cacheCellSize > 0 && std::isfinite(cacheCellSize) && cacheMaxError > 0 && std::isfinite(cacheMaxError))) {
+                std::cerr << "Radiance cache cell size and max error must be positive numbers" << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--clear-cache-per-frame") {
+            clearCachePerFrame = true;
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--resolution <nx> <ny>] [--samples <ns>] [--max-depth <depth>]"
+                      << " [--radiance-cache <cell size> <max error>] [--clear-cache-per-frame]"
+                      << " [--sequence <keyframes> <frames> <output prefix> | --server <socket path>]" << std::endl;
+            return 1;
+        }
+    }
+    std::string settingsError;
+    if (!settings.validate(settingsError)) {
+        std::cerr << settingsError << std::endl;
+        return 1;
+    }
 
-	vec3 lookFrom(13, 2, 3);
-	vec3 lookAt(0,0,0);
-	vec3 vUp(0,1,0); // determine "up" for the camera
-	double distToFocus = (lookFrom-lookAt).length();
-	double aperture = 0.05; // bigger = blurrier
+    std::vector<camera_keyframe> keyframes;
+    if (!keyframePath.empty()) {
+        std::ifstream keyframeFile(keyframePath);
+        std::string error;
+        if (!keyframeFile) {
+            std::cerr << "Couldn't open " << keyframePath << std::endl;
+            return 1;
+        }
+        if (!load_keyframes(keyframeFile, keyframes, error)) {
+            std::cerr << keyframePath << ": " << error << std::endl;
+            return 1;
+        }
+        if (frameCount <= 0) {
+            std::cerr << "Frame count must be positive" << std::endl;
+            return 1;
+        }
+        if (!check_camera_path(keyframes, settings, frameCount, error)) {
+            std::cerr << keyframePath << ": " << error << std::endl;
+            return 1;
+        }
+    }
 
     hittable *world = random_scene();
+    thread_pool pool;
+    std::unique_ptr<radiance_cache> cache;
+    if (useCache) {
+        cache.reset(new radiance_cache(cacheCellSize, cacheMaxError));
+    }
 
-	camera cam(lookFrom, lookAt, vec3(0,1,0), 20,double(nx)/double(ny), aperture, distToFocus);	
+    if (!socketPath.empty()) {
+        render_server server(world, pool, socketPath, cache.get());
+        return server.run() ? 0 : 1;
+    }
 
-   	auto start = std::chrono::high_resolution_clock::now();
+    if (!keyframes.empty()) {
+        auto start = std::chrono::high_resolution_clock::now();
+        bool written = render_sequence(world, pool, keyframes, settings, frameCount, outputPrefix,
+                                       cache.get(), clearCachePerFrame);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cerr << std::fixed << std::setprecision(2) << "Rendered " << frameCount << " frames in "
+                  << std::chrono::duration<double>(stop - start).count() << " seconds." << std::endl;
+        return written ? 0 : 1;
+    }
+
+	render_job job(settings, world, cache.get());
 
+   	auto start = std::chrono::high_resolution_clock::now();
 
-	for (int j = ny - 1; j >= 0; j--) { // Navigate canvas
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-		for (int i = 0; i < nx; i++) {
-			vec3 col(0, 0, 0);
-			for (int s = 0; s < ns; s++) { // Anti-aliasing - get ns samples for each pixel
-				double u = (i + random_double(0.0, 0.999)) / double(nx);
-				double v = (j + random_double(0.0, 0.999)) / double(ny);
-				ray r = cam.get_ray(u, v);
-				vec3 p = r.point_at_parameter(2.0);
-				col += color(r, world, maxDepth);
-			}
-
-			col /= double(ns); // Average the color between objects/background
-			col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));  // set gamma to 2
-			int ir = int(255.99 * col[0]);
-			int ig = int(255.99 * col[1]);
-			int ib = int(255.99 * col[2]);
-			std::cout << ir << " " << ig << " " << ib << "\n";
-		}
+	job.submit(pool);
+	while (!job.wait_for(std::chrono::milliseconds(200))) {
+        std::cerr << "\rScanlines remaining: " << job.rows_remaining() << ' ' << std::flush;
+	}
+	if (job.failed()) {
+        std::cerr << "\nRendering failed: " << job.error() << std::endl;
+        return 1;
 	}
+	job.write_ppm_ascii(std::cout);
+
     auto stop = std::chrono::high_resolution_clock::now();
 
 	auto hours = std::chrono::duration_cast<std::chrono::hours>(stop - start);
@@ -145,4 +203,8 @@ int main() {
 	"\t" << hours.count() << " hours" << std::endl <<
 	"\t" << minutes.count() << " minutes" << std::endl <<
 	"\t" << seconds.count() << " seconds." << std::endl;
+
+    if (cache) {
+        cache->print_stats(std::cerr);
+    }
 }
\ No newline at end of file
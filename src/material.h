@@ -41,6 +41,9 @@ class material {
                         const hit_record& rec, 
                         vec3& attenuation,
                         ray& scattered) const = 0;
+
+    // Diffuse surfaces scatter light independently of the view direction, so their radiance can be cached
+    virtual bool is_diffuse() const { return false; }
 };
 
 // Matte surface
@@ -58,6 +61,7 @@ class lambertian : public material {
             attenuation = albedo;
             return true;
         }
+        virtual bool is_diffuse() const { return true; }
     vec3 albedo; // reflectivity
 
 };
@@ -0,0 +1,188 @@
+#ifndef RADIANCECACHEH
+#define RADIANCECACHEH
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "vec3.h"
+
+/****************************************************************************************
+Radiance cache for diffuse indirect light.
+
+Light leaving a lambertian surface doesn't depend on the view direction, so once enough
+paths have passed through a small patch of a diffuse surface, their average is a good
+estimate for the next path that lands there. The cache is a spatial hash over
+(position, normal): position is snapped to a grid of cell_size, and the normal to one of
+5x5x5 directions so the two sides of a thin object don't share an entry.
+
+Paths add their result at every diffuse hit after the first diffuse bounce, and look the
+cache up at the same points; a cell is only used once it has min_samples samples and the
+standard error of its mean brightness is below max_error (relative). The first diffuse
+bounce is always traced, which keeps contact shadows and other sharp detail seen directly
+by the camera.
+
+The table is split into shards, each with its own lock, so render threads rarely wait on
+each other.
+*****************************************************************************************/
+class radiance_cache {
+public:
+	// Throws std::invalid_argument unless cell and error are positive and finite and samples is at least 1
+	radiance_cache(double cell = 0.2, double error = 0.3, int samples = 16)
+		: cell_size(cell), max_error(error), min_samples(samples), shards(new shard[shard_count]) {
+		if (!(cell > 0 && std::isfinite(cell) && error > 0 && std::isfinite(error) && samples >= 1)) {
+			throw std::invalid_argument("radiance cache cell size and max error must be positive and finite, and min samples at least 1");
+		}
+	}
+
+	radiance_cache(const radiance_cache&) = delete;
+	radiance_cache& operator=(const radiance_cache&) = delete;
+
+	// Returns true and sets radiance if the cell at (p, n) has converged
+	bool lookup(const vec3& p, const vec3& n, vec3& radiance) {
+		cache_key key = make_key(p, n);
+		shard& s = shard_for(key);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.lookups++;
+
+		auto found = s.entries.find(key);
+		if (found == s.entries.end() || !found->second.converged(min_samples, max_error)) {
+			return false;
+		}
+		s.hits++;
+		radiance = found->second.sum / double(found->second.count);
+		return true;
+	}
+
+	void insert(const vec3& p, const vec3& n, const vec3& radiance) {
+		cache_key key = make_key(p, n);
+		shard& s = shard_for(key);
+		std::lock_guard<std::mutex> lock(s.mutex);
+
+		entry& e = s.entries[key];
+		double brightness = luminance(radiance);
+		e.sum += radiance;
+		e.brightness_squared += brightness * brightness;
+		e.count++;
+	}
+
+	// Forget every entry and reset the statistics (e.g. between frames of a changing scene)
+	void clear() {
+		for (size_t i = 0; i < shard_count; i++) {
+			std::lock_guard<std::mutex> lock(shards[i].mutex);
+			shards[i].entries.clear();
+			shards[i].lookups = 0;
+			shards[i].hits = 0;
+		}
+	}
+
+	uint64_t lookups() const { return sum_over_shards([](const shard& s) { return s.lookups; }); }
+	uint64_t hits() const { return sum_over_shards([](const shard& s) { return s.hits; }); }
+	uint64_t entries() const { return sum_over_shards([](const shard& s) { return uint64_t(s.entries.size()); }); }
+
+	double hit_rate() const {
+		uint64_t l = lookups();
+		return l ? double(hits()) / double(l) : 0.0;
+	}
+
+	// Approximate heap use: one node (key, entry and next pointer) per entry plus the bucket arrays
+	uint64_t memory_bytes() const {
+		return sum_over_shards([](const shard& s) {
+			return uint64_t(s.entries.size()) * (sizeof(std::pair<const cache_key, entry>) + 2*sizeof(void*))
+				 + uint64_t(s.entries.bucket_count()) * sizeof(void*);
+		});
+	}
+
+	// One line: hit rate, entry count and approximate memory use
+	void print_stats(std::ostream& out) const {
+		out << "Radiance cache: " << 100.0 * hit_rate() << "% hit rate, "
+			<< entries() << " entries, " << memory_bytes() / 1024 << " KiB" << std::endl;
+	}
+
+	const double cell_size;
+	const double max_error;
+	const int min_samples;
+
+private:
+	struct cache_key {
+		int64_t x, y, z;
+		int normal;
+
+		bool operator==(const cache_key& other) const {
+			return x == other.x && y == other.y && z == other.z && normal == other.normal;
+		}
+	};
+
+	struct cache_key_hash {
+		size_t operator()(const cache_key& k) const {
+			uint64_t h = uint64_t(k.x) * 73856093u;
+			h ^= uint64_t(k.y) * 19349663u;
+			h ^= uint64_t(k.z) * 83492791u;
+			h ^= uint64_t(k.normal) * 2654435761u;
+			return size_t(h ^ (h >> 29));
+		}
+	};
+
+	struct entry {
+		vec3 sum = vec3(0, 0, 0);
+		double brightness_squared = 0;
+		int count = 0;
+
+		bool converged(int min_samples, double max_error) const {
+			if (count < min_samples) return false;
+			double mean = luminance(sum) / count;
+			double variance = fmax(brightness_squared / count - mean * mean, 0.0);
+			double standard_error = sqrt(variance / count);
+			return standard_error <= max_error * fmax(mean, 1e-3);
+		}
+	};
+
+	struct shard {
+		mutable std::mutex mutex;
+		std::unordered_map<cache_key, entry, cache_key_hash> entries;
+		uint64_t lookups = 0;
+		uint64_t hits = 0;
+	};
+
+	static const size_t shard_count = 64;
+
+	static double luminance(const vec3& c) {
+		return 0.2126*c.r() + 0.7152*c.g() + 0.0722*c.b();
+	}
+
+	cache_key make_key(const vec3& p, const vec3& n) const {
+		cache_key key;
+		key.x = int64_t(floor(p.x() / cell_size));
+		key.y = int64_t(floor(p.y() / cell_size));
+		key.z = int64_t(floor(p.z() / cell_size));
+		// n is a unit vector; round each component to one of {-1, -0.5, 0, 0.5, 1}
+		int nx = int(lround(n.x() * 2)) + 2;
+		int ny = int(lround(n.y() * 2)) + 2;
+		int nz = int(lround(n.z() * 2)) + 2;
+		key.normal = (nx * 5 + ny) * 5 + nz;
+		return key;
+	}
+
+	shard& shard_for(const cache_key& key) {
+		return shards[cache_key_hash()(key) % shard_count];
+	}
+
+	template <class F>
+	uint64_t sum_over_shards(F field) const {
+		uint64_t total = 0;
+		for (size_t i = 0; i < shard_count; i++) {
+			std::lock_guard<std::mutex> lock(shards[i].mutex);
+			total += field(shards[i]);
+		}
+		return total;
+	}
+
+	std::unique_ptr<shard[]> shards;
+};
+
+#endif // !RADIANCECACHEH
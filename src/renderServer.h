@@ -0,0 +1,348 @@
+#ifndef RENDERSERVERH
+#define RENDERSERVERH
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "renderer.h"
+#include "threadPool.h"
+
+/****************************************************************************************
+Long-lived render server.
+
+The scene is built once and kept in memory; clients connect to a local Unix socket and
+send render jobs, one per line:
+
+	lookFrom(x y z) lookAt(x y z) vUp(x y z) vFov aperture focusDistance nx ny ns maxDepth
+
+e.g. "13 2 3  0 0 0  0 1 0  20 0.05 13.5  400 200 10 50"
+
+Each job is answered, in order, with a status line followed by the image:
+
+	OK <latency in ms> <jobs in flight> <scanlines remaining>\n
+	P6 binary PPM (header + nx*ny*3 bytes)
+
+or "ERR <reason>\n" if the line couldn't be parsed or asks for more than the limits below.
+Jobs in flight and scanlines remaining (not yet rendered, summed over those jobs) are
+measured when the job arrives, counting the job itself.
+If a job fails while rendering, the client gets "ERR <reason>\n" and its connection is
+closed; other connections are unaffected. A connection may send any number of
+jobs; all connections share one thread pool, so their scanlines are interleaved.
+
+To bound memory, the server accepts at most max_connections clients and renders at most
+max_pixels_in_flight pixels at once; beyond that, connections and jobs get "ERR server busy".
+Images are sent straight from the job's pixel buffer, without another copy.
+
+If the server has a radiance cache, it is shared by every job. Sending "clear-cache"
+empties it and is answered with "OK\n".
+*****************************************************************************************/
+class render_server {
+public:
+	render_server(hittable *w, thread_pool& p, const std::string& path, radiance_cache *c = nullptr)
+		: world(w), pool(p), socket_path(path), cache(c) {}
+
+	// Bind the socket and serve clients until accept() fails or the process is killed.
+	// Returns false if the socket couldn't be opened; before returning, open connections are
+	// shut down and their threads joined, so nothing still uses the world or the pool.
+	bool run() {
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (socket_path.size() >= sizeof(address.sun_path)) {
+			std::cerr << "Socket path too long: " << socket_path << std::endl;
+			return false;
+		}
+		socket_path.copy(address.sun_path, socket_path.size());
+
+		int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0) {
+			perror("socket");
+			return false;
+		}
+		unlink(socket_path.c_str()); // remove a stale socket left by a previous server
+		if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+			perror("bind");
+			close(listen_fd);
+			return false;
+		}
+
+		std::cerr << "Listening on " << socket_path << " with " << pool.size() << " render threads" << std::endl;
+
+		while (true) {
+			int client_fd = accept(listen_fd, nullptr, nullptr);
+			if (client_fd < 0) {
+				if (errno == EINTR) continue;
+				perror("accept");
+				break;
+			}
+			std::lock_guard<std::mutex> lock(connections_mutex);
+			reap_finished_connections();
+			if (connections.size() >= max_connections) {
+				send_all(client_fd, "ERR server busy: too many connections\n");
+				close(client_fd);
+				continue;
+			}
+			connections.emplace_back();
+			auto c = std::prev(connections.end());
+			c->fd = client_fd;
+			c->thread = std::thread([this, c] {
+				serve(c->fd);
+				std::lock_guard<std::mutex> lock(connections_mutex);
+				close(c->fd);
+				c->finished = true;
+			});
+		}
+
+		close(listen_fd);
+		unlink(socket_path.c_str());
+		close_connections();
+		return false;
+	}
+
+	// Limits on a single job, so one request can't exhaust memory or the render threads' stacks
+	static const int64_t max_pixels = 8192 * 8192;
+	static const int max_samples = 65536;
+	static const int max_ray_depth = 1000; // color() recurses once per bounce
+
+	// Limits across jobs: each in-flight job holds nx*ny*3 bytes of pixels until its reply is sent
+	static const size_t max_connections = 32;
+	static const int64_t max_pixels_in_flight = 2 * max_pixels;
+
+	// Parse one job line. Returns false (and sets error) for malformed or out-of-range values.
+	static bool parse_request(const std::string& line, render_settings& settings, std::string& error) {
+		std::istringstream in(line);
+		in >> settings.look_from >> settings.look_at >> settings.v_up
+		   >> settings.v_fov >> settings.aperture >> settings.focus_distance
+		   >> settings.nx >> settings.ny >> settings.ns >> settings.max_depth;
+
+		if (in.fail()) {
+			error = "expected: lookFrom(3) lookAt(3) vUp(3) vFov aperture focusDistance nx ny ns maxDepth";
+			return false;
+		}
+		if (!settings.validate(error)) {
+			return false;
+		}
+		if (int64_t(settings.nx) * int64_t(settings.ny) > max_pixels) {
+			error = "nx*ny must be at most " + std::to_string(max_pixels);
+			return false;
+		}
+		if (settings.ns > max_samples) {
+			error = "ns must be at most " + std::to_string(max_samples);
+			return false;
+		}
+		if (settings.max_depth > max_ray_depth) {
+			error = "maxDepth must be at most " + std::to_string(max_ray_depth);
+			return false;
+		}
+		return true;
+	}
+
+private:
+	struct connection {
+		int fd = -1;
+		bool finished = false; // set (and fd closed) under connections_mutex when serve() returns
+		std::thread thread;
+	};
+
+	// Join threads whose client already hung up. Call with connections_mutex held.
+	void reap_finished_connections() {
+		for (auto c = connections.begin(); c != connections.end(); ) {
+			if (c->finished) {
+				c->thread.join();
+				c = connections.erase(c);
+			}
+			else {
+				++c;
+			}
+		}
+	}
+
+	// Hang up on every client; a job that is rendering finishes first, then its send fails.
+	void close_connections() {
+		{
+			std::lock_guard<std::mutex> lock(connections_mutex);
+			for (connection& c : connections) {
+				if (!c.finished) shutdown(c.fd, SHUT_RDWR);
+			}
+		}
+		for (connection& c : connections) {
+			c.thread.join();
+		}
+		connections.clear();
+	}
+
+	// Holds pixels against max_pixels_in_flight while it's in scope, if granted
+	struct pixel_reservation {
+		pixel_reservation(render_server& s, int64_t n) : server(s), pixels(n) {
+			std::lock_guard<std::mutex> lock(server.jobs_mutex);
+			granted = server.pixels_in_flight + pixels <= max_pixels_in_flight;
+			if (granted) server.pixels_in_flight += pixels;
+		}
+
+		~pixel_reservation() {
+			if (!granted) return;
+			std::lock_guard<std::mutex> lock(server.jobs_mutex);
+			server.pixels_in_flight -= pixels;
+		}
+
+		pixel_reservation(const pixel_reservation&) = delete;
+		pixel_reservation& operator=(const pixel_reservation&) = delete;
+
+		render_server& server;
+		int64_t pixels;
+		bool granted;
+	};
+
+	/*
+	* Keeps a job in active_jobs while it's in scope. On registering, it records the number of jobs
+	* in flight and the scanlines they still have to render (this job included).
+	*/
+	struct job_registration {
+		job_registration(render_server& s, render_job& job) : server(s) {
+			std::lock_guard<std::mutex> lock(server.jobs_mutex);
+			entry = server.active_jobs.insert(server.active_jobs.end(), &job);
+			id = ++server.job_count;
+			in_flight = server.active_jobs.size();
+			for (render_job *j : server.active_jobs) {
+				scanlines_remaining += j->rows_remaining();
+			}
+		}
+
+		~job_registration() {
+			std::lock_guard<std::mutex> lock(server.jobs_mutex);
+			server.active_jobs.erase(entry);
+		}
+
+		job_registration(const job_registration&) = delete;
+		job_registration& operator=(const job_registration&) = delete;
+
+		render_server& server;
+		std::list<render_job*>::iterator entry;
+		int id = 0;
+		size_t in_flight = 0;
+		int64_t scanlines_remaining = 0;
+	};
+
+	// A job that fails (e.g. std::bad_alloc for its pixels or while rendering) ends its own connection, not the server
+	void serve(int client_fd) {
+		try {
+			serve_jobs(client_fd);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Closing connection after error: " << e.what() << std::endl;
+			send_all(client_fd, std::string("ERR ") + e.what() + "\n");
+		}
+	}
+
+	void serve_jobs(int client_fd) {
+		std::string buffer;
+		std::string line;
+		while (read_line(client_fd, buffer, line)) {
+			if (line.empty()) continue;
+
+			if (line == "clear-cache") {
+				if (cache) cache->clear();
+				if (!send_all(client_fd, "OK\n")) break;
+				continue;
+			}
+
+			render_settings settings;
+			std::string error;
+			if (!parse_request(line, settings, error)) {
+				if (!send_all(client_fd, "ERR " + error + "\n")) break;
+				continue;
+			}
+
+			auto received = std::chrono::steady_clock::now();
+
+			pixel_reservation reservation(*this, int64_t(settings.nx) * int64_t(settings.ny));
+			if (!reservation.granted) {
+				if (!send_all(client_fd, "ERR server busy: too many pixels in flight, try again later\n")) break;
+				continue;
+			}
+			render_job job(settings, world, cache);
+			job_registration registration(*this, job);
+			job.submit(pool);
+			job.wait();
+			if (job.failed()) {
+				throw std::runtime_error("rendering failed: " + job.error());
+			}
+
+			double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - received).count();
+			std::cerr << "Job " << registration.id << ": " << settings.nx << "x" << settings.ny << " @ " << settings.ns << " spp"
+					  << " in " << latency_ms << " ms (jobs in flight: " << registration.in_flight
+					  << ", scanlines remaining: " << registration.scanlines_remaining << ")" << std::endl;
+			if (cache) {
+				std::cerr << "\t";
+				cache->print_stats(std::cerr);
+			}
+
+			std::ostringstream header;
+			header << "OK " << latency_ms << " " << registration.in_flight << " " << registration.scanlines_remaining << "\n"
+				   << job.ppm_header();
+			if (!send_all(client_fd, header.str()) ||
+				!send_all(client_fd, job.pixels.data(), job.pixels.size())) break;
+		}
+	}
+
+	// Pull the next '\n'-terminated line out of the socket. Returns false once the client hangs up.
+	static bool read_line(int fd, std::string& buffer, std::string& line) {
+		size_t newline;
+		while ((newline = buffer.find('\n')) == std::string::npos) {
+			char chunk[4096];
+			ssize_t n = read(fd, chunk, sizeof(chunk));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			buffer.append(chunk, n);
+		}
+		line = buffer.substr(0, newline);
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		buffer.erase(0, newline + 1);
+		return true;
+	}
+
+	static bool send_all(int fd, const std::string& data) {
+		return send_all(fd, data.data(), data.size());
+	}
+
+	static bool send_all(int fd, const unsigned char *data, size_t size) {
+		return send_all(fd, reinterpret_cast<const char*>(data), size);
+	}
+
+	static bool send_all(int fd, const char *data, size_t size) {
+		size_t sent = 0;
+		while (sent < size) {
+			ssize_t n = send(fd, data + sent, size - sent, MSG_NOSIGNAL); // don't die on SIGPIPE if the client left
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			sent += n;
+		}
+		return true;
+	}
+
+	hittable *world;
+	thread_pool& pool;
+	std::string socket_path;
+	radiance_cache *cache;
+	std::list<render_job*> active_jobs; // jobs being rendered, for the stats sent with each reply
+	std::mutex jobs_mutex;
+	int job_count = 0;
+	int64_t pixels_in_flight = 0; // reserved by pixel_reservation, guarded by jobs_mutex
+	std::list<connection> connections;
+	std::mutex connections_mutex;
+};
+
+#endif // !RENDERSERVERH
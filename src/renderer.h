@@ -0,0 +1,302 @@
+#ifndef RENDERERH
+#define RENDERERH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <float.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "camera.h"
+#include "material.h"
+#include "radianceCache.h"
+#include "threadPool.h"
+
+/*
+* Assign colors to pixels
+*
+* Depth is the number of reflections
+*
+* Background -
+* Linearly blends white and blue depending on the value of y coordinate (Linear Blend/Linear Interpolation/lerp).
+* Lerps are always of the form: blended_value = (1-t)*start_value + t*end_value.
+* t = 0.0 = White
+* t = 1.0 = Blue
+*
+* If a radiance cache is given, diffuse hits after the first diffuse bounce end the path early
+* when their cache cell has converged, and otherwise add their result to the cache.
+*/
+vec3 color(const ray& r, hittable *world, int depth, radiance_cache *cache = nullptr, int diffuseBounces = 0) {
+    hit_record rec;
+
+    if (depth <= 0) {
+        return vec3(0,0,0);
+    }
+    if (world->hit(r, 0.001, DBL_MAX, rec)) {
+        bool diffuse = rec.material_ptr->is_diffuse();
+        bool cacheable = cache && diffuse && diffuseBounces > 0;
+        vec3 cached;
+        if (cacheable && cache->lookup(rec.p, rec.normal, cached)) {
+            return cached;
+        }
+
+        ray scattered;
+        vec3 attenuation;
+        if (rec.material_ptr->scatter(r, rec, attenuation, scattered)) {
+            vec3 result = attenuation*color(scattered, world, depth-1, cache, diffuseBounces + (diffuse ? 1 : 0));
+            if (cacheable) {
+                cache->insert(rec.p, rec.normal, result);
+            }
+            return result;
+        }
+        else {
+            return vec3(0,0,0);
+        }
+    }
+    else {
+        vec3 unit_direction = unit_vector(r.direction());
+        double t = 0.5*(unit_direction.y() + 1.0);
+        return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
+    }
+}
+
+/*
+* Everything needed to render one image of a scene.
+* The camera fields mirror the arguments of the camera constructor.
+*/
+struct render_settings {
+	vec3 look_from = vec3(13, 2, 3);
+	vec3 look_at = vec3(0, 0, 0);
+	vec3 v_up = vec3(0, 1, 0); // determine "up" for the camera
+	double v_fov = 20;
+	double aperture = 0.05; // bigger = blurrier
+	double focus_distance = (vec3(13, 2, 3) - vec3(0, 0, 0)).length();
+
+	int nx = 2000; // Number of horizontal pixels
+	int ny = 1000; // Number of vertical pixels
+	int ns = 50; // Number of samples for each pixel for anti-aliasing (see AntiAliasing.png for visualization)
+	int max_depth = 50; // Ray bounce limit
+
+	camera make_camera() const {
+		return camera(look_from, look_at, v_up, v_fov, double(nx)/double(ny), aperture, focus_distance);
+	}
+
+	// Returns false (and sets error) if these values can't make a camera or an image.
+	// Comparisons are written so NaNs fail them too.
+	bool validate(std::string& error) const {
+		if (!(nx > 0 && ny > 0 && ns > 0 && max_depth > 0)) {
+			error = "nx, ny, ns and maxDepth must be positive";
+			return false;
+		}
+		if (!(v_fov > 0 && v_fov < 180)) {
+			error = "vFov must be between 0 and 180 degrees";
+			return false;
+		}
+		if (!(aperture >= 0 && focus_distance > 0)) {
+			error = "aperture can't be negative and focusDistance must be positive";
+			return false;
+		}
+		vec3 view = look_from - look_at;
+		if (!(view.length_squared() > 0)) {
+			error = "lookFrom and lookAt must be different points";
+			return false;
+		}
+		if (!(cross(v_up, view).length_squared() > 0)) {
+			error = "vUp must be non-zero and not parallel to the view direction";
+			return false;
+		}
+		return true;
+	}
+};
+
+/*
+* A single image being rendered on a thread_pool.
+*
+* The image is split into one task per scanline, but a job only keeps about one row per
+* worker queued at a time; each finished row queues the job's next one. Since the pool's queue
+* is FIFO, rows of all running jobs take turns, and a small job that arrives behind a big one
+* waits for a few rows rather than the whole image.
+*
+* If rendering or queuing a row throws, the job is marked failed, its remaining rows are
+* skipped (but still counted, so wait() returns) and failed()/error() say why.
+*
+* Pixels are stored as 8-bit RGB, top scanline first (the same order a PPM is written in).
+*/
+class render_job {
+public:
+	render_job(const render_settings& s, hittable *w, radiance_cache *c = nullptr)
+		: settings(s), pixels(size_t(s.nx) * size_t(s.ny) * 3),
+		  world(w), cache(c), cam(s.make_camera()), next_row(s.ny - 1), rows_left(s.ny) {}
+
+	render_job(const render_job&) = delete;
+	render_job& operator=(const render_job&) = delete;
+
+	// Start rendering on the pool. The job must outlive its tasks; call wait() before destroying it.
+	// Doesn't throw: a row that can't be queued fails the job instead.
+	void submit(thread_pool& p) {
+		pool = &p;
+		for (size_t k = 0; k < pool->size() && k < size_t(settings.ny); k++) {
+			queue_next_row();
+		}
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(done_mutex);
+		finished.wait(lock, [this] { return done; });
+	}
+
+	// Wait until every scanline has been queued on the pool; only the last few rows are left to render
+	void wait_all_rows_queued() {
+		std::unique_lock<std::mutex> lock(done_mutex);
+		finished.wait(lock, [this] { return all_rows_queued; });
+	}
+
+	// Returns false if the timeout elapsed before the job finished
+	template <class Rep, class Period>
+	bool wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+		std::unique_lock<std::mutex> lock(done_mutex);
+		return finished.wait_for(lock, timeout, [this] { return done; });
+	}
+
+	int rows_remaining() const { return rows_left; }
+
+	bool failed() const { return has_failed; }
+
+	// What made the job fail (the first error, if there were several)
+	std::string error() {
+		std::lock_guard<std::mutex> lock(done_mutex);
+		return error_message;
+	}
+
+	// Time from the first scanline starting until the last one finished. Time spent queued behind
+	// other jobs (e.g. the previous frame of a sequence) isn't counted.
+	std::chrono::steady_clock::duration elapsed() const { return stop_time - start_time; }
+
+	// Binary PPM (P6) - same layout as the ASCII output, but one byte per channel
+	std::string ppm_header() const {
+		return "P6\n" + std::to_string(settings.nx) + " " + std::to_string(settings.ny) + "\n255\n";
+	}
+
+	void write_ppm(std::ostream& out) const {
+		out << ppm_header();
+		out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+	}
+
+	// ASCII PPM (P3)
+	void write_ppm_ascii(std::ostream& out) const {
+		out << "P3\n" << settings.nx << " " << settings.ny << "\n255\n"; // P3 signifies ASCII, 255 signifies max color value
+		for (size_t i = 0; i < pixels.size(); i += 3) {
+			out << int(pixels[i]) << " " << int(pixels[i+1]) << " " << int(pixels[i+2]) << "\n";
+		}
+	}
+
+	render_settings settings;
+	std::vector<unsigned char> pixels;
+
+private:
+	// Queue the next unclaimed row. Once the job has failed, rows are claimed and counted as
+	// finished without rendering them, so the job still completes.
+	void queue_next_row() {
+		while (true) {
+			int j = next_row--;
+			if (j < 0) return;
+			if (j == 0) {
+				std::lock_guard<std::mutex> lock(done_mutex);
+				all_rows_queued = true;
+				finished.notify_all();
+			}
+
+			if (!has_failed) {
+				try {
+					pool->submit([this, j] { render_scanline(j); });
+					return;
+				}
+				catch (const std::exception& e) {
+					fail(e.what());
+				}
+			}
+			if (finish_row()) return; // the job may already be destroyed
+		}
+	}
+
+	void render_scanline(int j) {
+		if (!started.exchange(true)) {
+			start_time = std::chrono::steady_clock::now();
+		}
+
+		if (!has_failed) {
+			try {
+				render_pixels(j);
+			}
+			catch (const std::exception& e) {
+				fail(e.what());
+			}
+		}
+
+		queue_next_row();
+		finish_row();
+	}
+
+	void fail(const std::string& message) {
+		std::lock_guard<std::mutex> lock(done_mutex);
+		if (!has_failed) {
+			error_message = message;
+			has_failed = true;
+		}
+	}
+
+	// Count a row as done. Returns true if it was the last one; the waiting thread may then destroy the job.
+	bool finish_row() {
+		if (--rows_left != 0) return false;
+
+		std::lock_guard<std::mutex> lock(done_mutex);
+		stop_time = std::chrono::steady_clock::now();
+		if (!started) start_time = stop_time; // every row was skipped
+		done = true;
+		finished.notify_all();
+		return true;
+	}
+
+	void render_pixels(int j) {
+		unsigned char *row = &pixels[size_t(settings.ny - 1 - j) * settings.nx * 3];
+		for (int i = 0; i < settings.nx; i++) {
+			vec3 col(0, 0, 0);
+			for (int s = 0; s < settings.ns; s++) { // Anti-aliasing - get ns samples for each pixel
+				double u = (i + random_double(0.0, 0.999)) / double(settings.nx);
+				double v = (j + random_double(0.0, 0.999)) / double(settings.ny);
+				ray r = cam.get_ray(u, v);
+				col += color(r, world, settings.max_depth, cache);
+			}
+
+			col /= double(settings.ns); // Average the color between objects/background
+			col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));  // set gamma to 2
+			row[3*i]     = (unsigned char)(255.99 * col[0]);
+			row[3*i + 1] = (unsigned char)(255.99 * col[1]);
+			row[3*i + 2] = (unsigned char)(255.99 * col[2]);
+		}
+	}
+
+	hittable *world;
+	radiance_cache *cache;
+	camera cam;
+	thread_pool *pool = nullptr;
+	std::atomic<int> next_row;
+	std::atomic<int> rows_left;
+	std::atomic<bool> started{false};
+	std::atomic<bool> has_failed{false};
+	std::string error_message;
+	std::chrono::steady_clock::time_point start_time;
+	std::chrono::steady_clock::time_point stop_time;
+	std::mutex done_mutex;
+	std::condition_variable finished;
+	bool done = false;
+	bool all_rows_queued = false;
+};
+
+#endif // !RENDERERH
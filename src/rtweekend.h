@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <random>
+#include <atomic>
 
 
 // Usings
@@ -26,7 +28,12 @@ inline double degrees_to_radians(double degrees) {
 
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    // Each thread gets its own generator so worker threads don't contend on rand()'s lock.
+    // Seeds are handed out in order, so the first thread (the one building the scene) is deterministic.
+    static std::atomic<unsigned int> next_seed(1);
+    static thread_local std::mt19937 generator(next_seed++);
+    static thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(generator);
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,243 @@
+#ifndef SEQUENCEH
+#define SEQUENCEH
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "renderer.h"
+#include "threadPool.h"
+
+/****************************************************************************************
+Multi-frame (animation) rendering.
+
+A camera path is a list of keyframes, one per line, with the same camera parameters as
+the camera constructor plus a time:
+
+	time lookFrom(x y z) lookAt(x y z) vUp(x y z) vFov aperture focusDistance
+
+Blank lines and lines starting with '#' are ignored. Frames are spread evenly over the
+keyframe times and the camera is linearly interpolated between neighbouring keyframes.
+*****************************************************************************************/
+struct camera_keyframe {
+	int line; // where it came from, for error messages
+	double time;
+	vec3 look_from;
+	vec3 look_at;
+	vec3 v_up;
+	double v_fov;
+	double aperture;
+	double focus_distance;
+};
+
+inline double lerp(double a, double b, double t) { return (1.0-t)*a + t*b; }
+inline vec3 lerp(const vec3& a, const vec3& b, double t) { return (1.0-t)*a + t*b; }
+
+// base with its camera replaced by the keyframe's
+render_settings with_camera(const render_settings& base, const camera_keyframe& key) {
+	render_settings settings = base;
+	settings.look_from = key.look_from;
+	settings.look_at = key.look_at;
+	settings.v_up = key.v_up;
+	settings.v_fov = key.v_fov;
+	settings.aperture = key.aperture;
+	settings.focus_distance = key.focus_distance;
+	return settings;
+}
+
+// Returns false (and sets error) if a line can't be parsed, doesn't describe a valid camera,
+// or the times aren't increasing
+bool load_keyframes(std::istream& in, std::vector<camera_keyframe>& keyframes, std::string& error) {
+	std::string line;
+	int line_number = 0;
+	while (std::getline(in, line)) {
+		line_number++;
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#') continue;
+
+		camera_keyframe key;
+		key.line = line_number;
+		std::istringstream fields(line);
+		fields >> key.time >> key.look_from >> key.look_at >> key.v_up
+			   >> key.v_fov >> key.aperture >> key.focus_distance;
+		if (fields.fail()) {
+			error = "line " + std::to_string(line_number) + ": expected time lookFrom(3) lookAt(3) vUp(3) vFov aperture focusDistance";
+			return false;
+		}
+		std::string camera_error;
+		if (!with_camera(render_settings(), key).validate(camera_error)) {
+			error = "line " + std::to_string(line_number) + ": " + camera_error;
+			return false;
+		}
+		if (!keyframes.empty() && key.time <= keyframes.back().time) {
+			error = "line " + std::to_string(line_number) + ": keyframe times must be increasing";
+			return false;
+		}
+		keyframes.push_back(key);
+	}
+	if (keyframes.empty()) {
+		error = "no keyframes";
+		return false;
+	}
+	return true;
+}
+
+// Frames are spread evenly from the first keyframe's time to the last one's
+double frame_time(const std::vector<camera_keyframe>& keyframes, int frame, int frame_count) {
+	double start = keyframes.front().time;
+	double end = keyframes.back().time;
+	return (frame_count > 1) ? lerp(start, end, double(frame) / (frame_count - 1)) : start;
+}
+
+/*
+* Camera at time t, clamped to the first/last keyframe. Image size and sample counts come from base.
+* a and b are set to the keyframes it was interpolated between.
+*/
+render_settings camera_at(const std::vector<camera_keyframe>& keyframes, double time, const render_settings& base,
+						  const camera_keyframe **a = nullptr, const camera_keyframe **b = nullptr) {
+	size_t next = 0;
+	while (next < keyframes.size() && keyframes[next].time < time) next++;
+
+	const camera_keyframe& from = keyframes[next == 0 ? 0 : next - 1];
+	const camera_keyframe& to = keyframes[next == keyframes.size() ? next - 1 : next];
+	double t = (to.time > from.time) ? (time - from.time) / (to.time - from.time) : 0.0;
+	if (a) *a = &from;
+	if (b) *b = &to;
+
+	camera_keyframe key = from;
+	key.time = time;
+	key.look_from = lerp(from.look_from, to.look_from, t);
+	key.look_at = lerp(from.look_at, to.look_at, t);
+	key.v_up = lerp(from.v_up, to.v_up, t); // the camera only needs its direction, and a zero vector is caught by validate()
+	key.v_fov = lerp(from.v_fov, to.v_fov, t);
+	key.aperture = lerp(from.aperture, to.aperture, t);
+	key.focus_distance = lerp(from.focus_distance, to.focus_distance, t);
+	return with_camera(base, key);
+}
+
+/*
+* Interpolation can produce a camera neither keyframe has (e.g. vUp flipping through zero), so check
+* every frame before rendering. Returns false and sets error naming the frame and its keyframes' lines.
+*/
+bool check_camera_path(const std::vector<camera_keyframe>& keyframes, const render_settings& base,
+					   int frame_count, std::string& error) {
+	for (int frame = 0; frame < frame_count; frame++) {
+		const camera_keyframe *a, *b;
+		render_settings settings = camera_at(keyframes, frame_time(keyframes, frame, frame_count), base, &a, &b);
+		std::string camera_error;
+		if (!settings.validate(camera_error)) {
+			error = "frame " + std::to_string(frame) + " (between keyframes on lines " + std::to_string(a->line)
+				  + " and " + std::to_string(b->line) + "): " + camera_error;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+* Render frame_count frames of the camera path into <output_prefix>0000.ppm, <output_prefix>0001.ppm, ...
+*
+* Every scanline of every frame goes through the same thread pool. Frame k+1 is started as soon as
+* frame k has queued its last rows, so workers that finish the tail of frame k move straight on to
+* frame k+1 instead of idling, while frames still render one after another rather than sharing the
+* pool. Up to frames_in_flight frames (rendering or waiting to be written) exist at once. Finished frames are written (binary PPM) on a separate thread, in order.
+*
+* A radiance cache, if given, is shared by all frames and its printed stats cover every frame so far.
+* With clear_cache_each_frame it is emptied before each frame, once the previous frame has been
+* rendered and written, so every frame (and its stats) only sees its own entries. Frames can't
+* overlap in that mode.
+*/
+bool render_sequence(hittable *world, thread_pool& pool, const std::vector<camera_keyframe>& keyframes,
+					 const render_settings& base, int frame_count, const std::string& output_prefix,
+					 radiance_cache *cache = nullptr, bool clear_cache_each_frame = false,
+					 size_t frames_in_flight = 2) {
+	if (frames_in_flight < 1) frames_in_flight = 1;
+	bool clear_cache = cache && clear_cache_each_frame;
+	if (clear_cache) frames_in_flight = 1; // drain the previous frame before clearing
+
+	std::deque<std::unique_ptr<render_job>> frames; // submitted, not yet written
+	std::mutex frames_mutex;
+	std::condition_variable frames_changed;
+	bool all_submitted = false;
+	bool write_failed = false;
+
+	std::thread writer([&] {
+		for (int frame = 0; ; frame++) {
+			render_job *job;
+			{
+				std::unique_lock<std::mutex> lock(frames_mutex);
+				frames_changed.wait(lock, [&] { return !frames.empty() || all_submitted; });
+				if (frames.empty()) return;
+				job = frames.front().get();
+			}
+
+			job->wait();
+
+			std::ostringstream name;
+			name << output_prefix << std::setw(4) << std::setfill('0') << frame << ".ppm";
+			if (job->failed()) {
+				std::cerr << "Frame " << frame + 1 << "/" << frame_count << " failed: " << job->error() << std::endl;
+				std::lock_guard<std::mutex> lock(frames_mutex);
+				write_failed = true;
+				frames.pop_front();
+				frames_changed.notify_all();
+				continue;
+			}
+			std::ofstream out(name.str(), std::ios::binary);
+			job->write_ppm(out);
+			out.close();
+
+			double ms = std::chrono::duration<double, std::milli>(job->elapsed()).count();
+			std::cerr << "Frame " << frame + 1 << "/" << frame_count << " -> " << name.str()
+					  << " (" << ms << " ms)" << std::endl;
+			if (cache) {
+				std::cerr << "\t";
+				cache->print_stats(std::cerr);
+			}
+
+			std::lock_guard<std::mutex> lock(frames_mutex);
+			if (!out) {
+				std::cerr << "Couldn't write " << name.str() << std::endl;
+				write_failed = true;
+			}
+			frames.pop_front();
+			frames_changed.notify_all();
+		}
+	});
+
+	for (int frame = 0; frame < frame_count; frame++) {
+		double time = frame_time(keyframes, frame, frame_count);
+
+		std::unique_lock<std::mutex> lock(frames_mutex);
+		frames_changed.wait(lock, [&] { return frames.size() < frames_in_flight; });
+		if (!frames.empty()) {
+			frames.back()->wait_all_rows_queued(); // the writer can't pop it while we hold the lock
+		}
+
+		if (clear_cache) {
+			cache->clear();
+		}
+		frames.push_back(std::unique_ptr<render_job>(new render_job(camera_at(keyframes, time, base), world, cache)));
+		frames.back()->submit(pool);
+		frames_changed.notify_all();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(frames_mutex);
+		all_submitted = true;
+	}
+	frames_changed.notify_all();
+	writer.join();
+
+	return !write_failed;
+}
+
+#endif // !SEQUENCEH
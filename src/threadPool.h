@@ -0,0 +1,86 @@
+#ifndef THREADPOOLH
+#define THREADPOOLH
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* A fixed set of worker threads pulling tasks off a shared FIFO queue.
+*
+* Render jobs are broken up into one task per scanline, so any number of jobs
+* can share the same pool and interleave with each other.
+*/
+class thread_pool {
+public:
+	thread_pool(unsigned int thread_count = std::thread::hardware_concurrency()) {
+		if (thread_count == 0) thread_count = 1;
+		for (unsigned int i = 0; i < thread_count; i++) {
+			workers.emplace_back([this] { work(); });
+		}
+	}
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			stopping = true;
+		}
+		task_available.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			tasks.push_back(std::move(task));
+		}
+		task_available.notify_one();
+	}
+
+	// Number of tasks waiting for a worker (not counting the ones currently running)
+	size_t queue_depth() {
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		return tasks.size();
+	}
+
+	size_t size() const { return workers.size(); }
+
+private:
+	void work() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				task_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty()) return;
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			try {
+				task();
+			}
+			catch (const std::exception& e) {
+				// Tasks should handle their own errors (render_job does); don't let one take the process down
+				std::cerr << "Thread pool task failed: " << e.what() << std::endl;
+			}
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex queue_mutex;
+	std::condition_variable task_available;
+	bool stopping = false;
+};
+
+#endif // !THREADPOOLH